@@ -0,0 +1,496 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <charconv>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+/**
+ * Baseline comparison for the LLM codecs
+ *
+ * Runs general-purpose compressors through their libraries on the same
+ * input and reports ratio and MB/s in both directions next to base_codec,
+ * comp_codec and final_codec:
+ * 1. zstd at several levels with long-distance matching (as zstd --long,
+ *    a 128 MB window), using all cores to compress
+ * 2. pigz-style gzip: 128 KB chunks deflated in parallel, each primed with
+ *    the 32 KB before it, joined into one gzip stream
+ * 3. xz (liblzma preset 6, multi-threaded encoder)
+ * 4. Blosc-style byte shuffle + zstd on independent blocks
+ * Baselines run in memory. Our codecs run as child processes from the
+ * same bin directory, so their times include reading and writing files.
+ * zstd and xz are left out when the build did not find their libraries.
+ */
+
+class CodecBenchmark {
+public:
+    using Bytes = std::vector<uint8_t>;
+
+    struct Options {
+        int runs = 1;                       // best of this many timings
+        std::vector<int> zstd_levels = {1, 3, 9, 19};
+        size_t typesize = 4;                // Blosc-style shuffle element size
+        unsigned int threads = 0;           // 0 for every core
+        bool codecs = true;                 // also run base/comp/final_codec
+    };
+
+    struct Result {
+        std::string name;
+        uint64_t compressed = 0;
+        double compress_seconds = 0;
+        double decompress_seconds = 0;
+        bool lossless = false;
+        bool ok = false;
+    };
+
+private:
+    // Library compressor: compress(input, output), decompress(input, output
+    // sized to the original)
+    struct Baseline {
+        std::string name;
+        std::function<bool(const Bytes&, Bytes&)> compress;
+        std::function<bool(const Bytes&, Bytes&)> decompress;
+    };
+
+    static constexpr size_t PIGZ_CHUNK = 128 * 1024;
+    static constexpr size_t PIGZ_DICT = 32 * 1024;
+    static constexpr size_t BLOSC_BLOCK = 256 * 1024;
+
+    static unsigned int worker_count(const Options& options) {
+        if (options.threads) return options.threads;
+        unsigned int n = std::thread::hardware_concurrency();
+        return n == 0 ? 4 : n;
+    }
+
+    // Run fn(i) for every i in [0, count) on up to num_threads workers
+    template <typename Fn>
+    static void parallel_for(size_t count, unsigned int num_threads, Fn fn) {
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < std::min<size_t>(num_threads, count); t++) {
+            workers.emplace_back([&]() {
+                for (size_t i = next++; i < count; i = next++) fn(i);
+            });
+        }
+        for (auto& w : workers) w.join();
+    }
+
+    template <typename T>
+    static void put(Bytes& out, T value) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), p, p + sizeof(T));
+    }
+
+    static double seconds_since(std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // pigz: every chunk is a raw DEFLATE run ending in a sync flush (the
+    // last one finishes the stream), so the runs concatenate into one stream
+    static bool pigz_compress(const Bytes& input, Bytes& output, unsigned int threads) {
+        size_t chunks = std::max<size_t>(1, (input.size() + PIGZ_CHUNK - 1) / PIGZ_CHUNK);
+        std::vector<Bytes> runs(chunks);
+        std::vector<uLong> crcs(chunks);
+        std::atomic<bool> ok{true};
+        parallel_for(chunks, threads, [&](size_t c) {
+            size_t begin = c * PIGZ_CHUNK;
+            size_t size = std::min(PIGZ_CHUNK, input.size() - begin);
+            z_stream zs{};
+            if (deflateInit2(&zs, 6, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                ok = false;
+                return;
+            }
+            if (begin > 0) {
+                size_t dict = std::min(PIGZ_DICT, begin);
+                deflateSetDictionary(&zs, input.data() + begin - dict, static_cast<uInt>(dict));
+            }
+            runs[c].resize(deflateBound(&zs, size) + 16);
+            zs.next_in = const_cast<Bytef*>(input.data() + begin);
+            zs.avail_in = static_cast<uInt>(size);
+            zs.next_out = runs[c].data();
+            zs.avail_out = static_cast<uInt>(runs[c].size());
+            int ret = deflate(&zs, c + 1 == chunks ? Z_FINISH : Z_SYNC_FLUSH);
+            if (ret != Z_STREAM_END && ret != Z_OK) ok = false;
+            runs[c].resize(zs.total_out);
+            deflateEnd(&zs);
+            crcs[c] = crc32(0L, input.data() + begin, static_cast<uInt>(size));
+        });
+
+        output = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        uLong crc = crc32(0L, Z_NULL, 0);
+        for (size_t c = 0; c < chunks; c++) {
+            output.insert(output.end(), runs[c].begin(), runs[c].end());
+            size_t size = std::min(PIGZ_CHUNK, input.size() - std::min(input.size(), c * PIGZ_CHUNK));
+            crc = crc32_combine(crc, crcs[c], static_cast<z_off_t>(size));
+        }
+        put<uint32_t>(output, static_cast<uint32_t>(crc));
+        put<uint32_t>(output, static_cast<uint32_t>(input.size()));
+        return ok;
+    }
+
+    // Like pigz -d: one inflate over the whole stream
+    static bool gzip_decompress(const Bytes& input, Bytes& output) {
+        z_stream zs{};
+        if (inflateInit2(&zs, MAX_WBITS + 16) != Z_OK) return false;
+        zs.next_in = const_cast<Bytef*>(input.data());
+        size_t in_left = input.size(), out_left = output.size();
+        uint8_t* out = output.data();
+        int ret = Z_OK;
+        while (ret == Z_OK) {
+            uInt in_chunk = static_cast<uInt>(std::min<size_t>(in_left, 1u << 30));
+            uInt out_chunk = static_cast<uInt>(std::min<size_t>(out_left, 1u << 30));
+            zs.avail_in = in_chunk;
+            zs.next_out = out;
+            zs.avail_out = out_chunk;
+            ret = inflate(&zs, Z_NO_FLUSH);
+            in_left -= in_chunk - zs.avail_in;
+            out += out_chunk - zs.avail_out;
+            out_left -= out_chunk - zs.avail_out;
+            if (ret == Z_OK && in_chunk == zs.avail_in && out_chunk == zs.avail_out) break;
+        }
+        inflateEnd(&zs);
+        return ret == Z_STREAM_END && out_left == 0;
+    }
+
+#ifdef HAVE_ZSTD
+    static bool zstd_compress(const Bytes& input, Bytes& output, int level, unsigned int threads) {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, 27);
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, static_cast<int>(threads));   // ignored without ZSTD_MULTITHREAD
+        output.resize(ZSTD_compressBound(input.size()));
+        size_t n = ZSTD_compress2(cctx, output.data(), output.size(), input.data(), input.size());
+        ZSTD_freeCCtx(cctx);
+        if (ZSTD_isError(n)) return false;
+        output.resize(n);
+        return true;
+    }
+
+    static bool zstd_decompress(const Bytes& input, Bytes& output) {
+        ZSTD_DCtx* dctx = ZSTD_createDCtx();
+        ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, 27);
+        size_t n = ZSTD_decompressDCtx(dctx, output.data(), output.size(), input.data(), input.size());
+        ZSTD_freeDCtx(dctx);
+        return !ZSTD_isError(n) && n == output.size();
+    }
+
+    // Blosc: each block is byte-shuffled by element size and compressed on
+    // its own, so both directions run in parallel. Stored as u32 size + frame.
+    static void shuffle(const uint8_t* src, size_t size, size_t typesize, uint8_t* dst) {
+        size_t elements = size / typesize;
+        for (size_t b = 0; b < typesize; b++) {
+            for (size_t i = 0; i < elements; i++) dst[b * elements + i] = src[i * typesize + b];
+        }
+        std::memcpy(dst + elements * typesize, src + elements * typesize, size - elements * typesize);
+    }
+
+    static void unshuffle(const uint8_t* src, size_t size, size_t typesize, uint8_t* dst) {
+        size_t elements = size / typesize;
+        for (size_t b = 0; b < typesize; b++) {
+            for (size_t i = 0; i < elements; i++) dst[i * typesize + b] = src[b * elements + i];
+        }
+        std::memcpy(dst + elements * typesize, src + elements * typesize, size - elements * typesize);
+    }
+
+    static bool blosc_compress(const Bytes& input, Bytes& output, size_t typesize, unsigned int threads) {
+        size_t blocks = (input.size() + BLOSC_BLOCK - 1) / BLOSC_BLOCK;
+        std::vector<Bytes> frames(blocks);
+        std::atomic<bool> ok{true};
+        parallel_for(blocks, threads, [&](size_t b) {
+            size_t begin = b * BLOSC_BLOCK;
+            size_t size = std::min(BLOSC_BLOCK, input.size() - begin);
+            Bytes shuffled(size);
+            shuffle(input.data() + begin, size, typesize, shuffled.data());
+            frames[b].resize(ZSTD_compressBound(size));
+            size_t n = ZSTD_compress(frames[b].data(), frames[b].size(), shuffled.data(), size, 3);
+            if (ZSTD_isError(n)) ok = false;
+            frames[b].resize(ZSTD_isError(n) ? 0 : n);
+        });
+        output.clear();
+        for (const auto& frame : frames) {
+            put<uint32_t>(output, static_cast<uint32_t>(frame.size()));
+            output.insert(output.end(), frame.begin(), frame.end());
+        }
+        return ok;
+    }
+
+    static bool blosc_decompress(const Bytes& input, Bytes& output, size_t typesize, unsigned int threads) {
+        // Every frame must lie inside the input
+        std::vector<std::pair<size_t, size_t>> frames;
+        for (size_t at = 0; at < input.size();) {
+            uint32_t size;
+            if (input.size() - at < 4) return false;
+            std::memcpy(&size, input.data() + at, sizeof(size));
+            if (size > input.size() - at - 4) return false;
+            frames.push_back({at + 4, size});
+            at += 4 + size;
+        }
+        if (frames.size() != (output.size() + BLOSC_BLOCK - 1) / BLOSC_BLOCK) return false;
+        std::atomic<bool> ok{true};
+        parallel_for(frames.size(), threads, [&](size_t b) {
+            size_t begin = b * BLOSC_BLOCK;
+            size_t size = std::min(BLOSC_BLOCK, output.size() - begin);
+            Bytes shuffled(size);
+            size_t n = ZSTD_decompress(shuffled.data(), size, input.data() + frames[b].first, frames[b].second);
+            if (ZSTD_isError(n) || n != size) {
+                ok = false;
+                return;
+            }
+            unshuffle(shuffled.data(), size, typesize, output.data() + begin);
+        });
+        return ok;
+    }
+#endif
+
+#ifdef HAVE_LZMA
+    static bool xz_compress(const Bytes& input, Bytes& output, unsigned int threads) {
+        lzma_stream strm = LZMA_STREAM_INIT;
+        lzma_mt mt{};
+        mt.threads = threads;
+        mt.preset = 6;
+        mt.check = LZMA_CHECK_CRC64;
+        if (lzma_stream_encoder_mt(&strm, &mt) != LZMA_OK) return false;
+        output.resize(lzma_stream_buffer_bound(input.size()));
+        strm.next_in = input.data();
+        strm.avail_in = input.size();
+        strm.next_out = output.data();
+        strm.avail_out = output.size();
+        lzma_ret ret = lzma_code(&strm, LZMA_FINISH);
+        while (ret == LZMA_OK) ret = lzma_code(&strm, LZMA_FINISH);
+        output.resize(strm.total_out);
+        lzma_end(&strm);
+        return ret == LZMA_STREAM_END;
+    }
+
+    static bool xz_decompress(const Bytes& input, Bytes& output) {
+        uint64_t memlimit = UINT64_MAX;
+        size_t in_pos = 0, out_pos = 0;
+        lzma_ret ret = lzma_stream_buffer_decode(&memlimit, 0, nullptr, input.data(), &in_pos, input.size(),
+                                                 output.data(), &out_pos, output.size());
+        return ret == LZMA_OK && out_pos == output.size();
+    }
+#endif
+
+    static std::vector<Baseline> baselines(const Options& options) {
+        unsigned int threads = worker_count(options);
+        std::vector<Baseline> list;
+#ifdef HAVE_ZSTD
+        for (int level : options.zstd_levels) {
+            list.push_back({"zstd -" + std::to_string(level) + " --long",
+                            [=](const Bytes& in, Bytes& out) { return zstd_compress(in, out, level, threads); },
+                            zstd_decompress});
+        }
+#endif
+        list.push_back({"pigz -6",
+                        [=](const Bytes& in, Bytes& out) { return pigz_compress(in, out, threads); },
+                        gzip_decompress});
+#ifdef HAVE_LZMA
+        list.push_back({"xz -6",
+                        [=](const Bytes& in, Bytes& out) { return xz_compress(in, out, threads); },
+                        xz_decompress});
+#endif
+#ifdef HAVE_ZSTD
+        size_t typesize = options.typesize;
+        list.push_back({"blosc shuffle(" + std::to_string(typesize) + ")+zstd -3",
+                        [=](const Bytes& in, Bytes& out) { return blosc_compress(in, out, typesize, threads); },
+                        [=](const Bytes& in, Bytes& out) { return blosc_decompress(in, out, typesize, threads); }});
+#endif
+        return list;
+    }
+
+    static Result run_baseline(const Baseline& baseline, const Bytes& input, const Options& options) {
+        Result result;
+        result.name = baseline.name;
+        Bytes compressed, restored(input.size());
+        for (int r = 0; r < options.runs; r++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            if (!baseline.compress(input, compressed)) return result;
+            double seconds = seconds_since(start);
+            if (r == 0 || seconds < result.compress_seconds) result.compress_seconds = seconds;
+        }
+        for (int r = 0; r < options.runs; r++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            if (!baseline.decompress(compressed, restored)) return result;
+            double seconds = seconds_since(start);
+            if (r == 0 || seconds < result.decompress_seconds) result.decompress_seconds = seconds;
+        }
+        result.compressed = compressed.size();
+        result.lossless = restored == input;
+        result.ok = true;
+        return result;
+    }
+
+    static std::string quote(const std::string& text) {
+        std::string out = "'";
+        for (char c : text) out += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        return out + "'";
+    }
+
+    // One of our codecs as a child process: -c then -d, timed from outside
+    static Result run_codec(const std::filesystem::path& binary, const std::string& args,
+                            const std::string& input_path, const Bytes& input, const Options& options) {
+        Result result;
+        result.name = binary.filename().string() + (args.empty() ? "" : " " + args);
+        if (!std::filesystem::exists(binary)) return result;
+
+        auto temp = std::filesystem::temp_directory_path() / ("bench_codec." + std::to_string(getpid()));
+        std::string archive = temp.string() + ".llmc";
+        std::string restored_path = temp.string() + std::filesystem::path(input_path).extension().string();
+        std::string compress = quote(binary.string()) + " -c " + quote(input_path) + " " + quote(archive) +
+                               (args.empty() ? "" : " " + args) + " > /dev/null";
+        std::string decompress = quote(binary.string()) + " -d " + quote(archive) + " " + quote(restored_path) +
+                                 " > /dev/null";
+        for (int r = 0; r < options.runs; r++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            if (std::system(compress.c_str()) != 0) return result;
+            double seconds = seconds_since(start);
+            if (r == 0 || seconds < result.compress_seconds) result.compress_seconds = seconds;
+        }
+        for (int r = 0; r < options.runs; r++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            if (std::system(decompress.c_str()) != 0) return result;
+            double seconds = seconds_since(start);
+            if (r == 0 || seconds < result.decompress_seconds) result.decompress_seconds = seconds;
+        }
+
+        std::error_code ec;
+        result.compressed = std::filesystem::file_size(archive, ec);
+        std::ifstream restored(restored_path, std::ios::binary);
+        Bytes data((std::istreambuf_iterator<char>(restored)), std::istreambuf_iterator<char>());
+        result.lossless = data == input;
+        result.ok = !ec;
+        std::filesystem::remove(archive, ec);
+        std::filesystem::remove(restored_path, ec);
+        return result;
+    }
+
+public:
+    static bool run(const std::string& input_path, const std::filesystem::path& bin_dir, const Options& options) {
+        std::ifstream file(input_path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Cannot open input file: " << input_path << std::endl;
+            return false;
+        }
+        Bytes input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+        std::cout << "Input: " << input_path << " (" << input.size() / (1024.0 * 1024.0) << " MB), "
+                  << worker_count(options) << " threads, best of " << options.runs << std::endl;
+
+        std::vector<Result> results;
+        for (const auto& baseline : baselines(options)) {
+            std::cout << "Running " << baseline.name << "..." << std::endl;
+            results.push_back(run_baseline(baseline, input, options));
+        }
+        if (options.codecs) {
+            const std::pair<const char*, const char*> codecs[] = {
+                {"base_codec", ""}, {"comp_codec", ""}, {"final_codec", ""}, {"final_codec", "--bitplanes"}};
+            for (const auto& [name, args] : codecs) {
+                std::cout << "Running " << name << (*args ? " " : "") << args << "..." << std::endl;
+                results.push_back(run_codec(bin_dir / name, args, input_path, input, options));
+            }
+        }
+
+        std::cout << "\n=== Benchmark Results ===" << std::endl;
+        std::cout << "| Codec | Ratio | Compress MB/s | Decompress MB/s | Lossless |" << std::endl;
+        std::cout << "|---|---|---|---|---|" << std::endl;
+        double mb = input.size() / (1024.0 * 1024.0);
+        for (const auto& r : results) {
+            if (!r.ok) {
+                std::cout << "| " << r.name << " | failed | - | - | - |" << std::endl;
+                continue;
+            }
+            std::ostringstream line;
+            line.precision(4);
+            line << "| " << r.name << " | " << static_cast<double>(input.size()) / std::max<uint64_t>(r.compressed, 1)
+                 << " | " << mb / std::max(r.compress_seconds, 1e-9)
+                 << " | " << mb / std::max(r.decompress_seconds, 1e-9)
+                 << " | " << (r.lossless ? "yes" : "no") << " |";
+            std::cout << line.str() << std::endl;
+        }
+        std::cout << "\nBaselines run in memory; codec times include file I/O and process start." << std::endl;
+#ifndef HAVE_ZSTD
+        std::cout << "zstd and Blosc-style rows missing: built without zstd." << std::endl;
+#endif
+#ifndef HAVE_LZMA
+        std::cout << "xz row missing: built without liblzma." << std::endl;
+#endif
+        return true;
+    }
+};
+
+static void print_usage(std::ostream& out, const char* program) {
+    out << "Baseline comparison against standard compressors" << std::endl;
+    out << "Usage: " << program << " <input> [--runs N] [--levels 1,3,9,19] [--typesize N]" << std::endl;
+    out << "       [--threads N] [--no-codecs]" << std::endl;
+}
+
+// Whole-string number of type T; otherwise prints the usage and fails
+template <typename T>
+static bool parse_number(const char* program, const std::string& option, const std::string& text, T& value) {
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || end != text.data() + text.size() || text.empty()) {
+        std::cerr << option << ": invalid or out-of-range number '" << text << "'" << std::endl;
+        print_usage(std::cerr, program);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(std::cout, argv[0]);
+        return 1;
+    }
+
+    CodecBenchmark::Options options;
+    for (int i = 2; i < argc; i++) {
+        std::string opt = argv[i];
+        if (opt == "--runs" && i + 1 < argc) {
+            if (!parse_number(argv[0], opt, argv[++i], options.runs)) return 1;
+            options.runs = std::max(1, options.runs);
+        } else if (opt == "--levels" && i + 1 < argc) {
+            options.zstd_levels.clear();
+            std::stringstream spec(argv[++i]);
+            std::string text;
+            while (std::getline(spec, text, ',')) {
+                int level;
+                if (!parse_number(argv[0], opt, text, level)) return 1;
+                options.zstd_levels.push_back(level);
+            }
+        } else if (opt == "--typesize" && i + 1 < argc) {
+            if (!parse_number(argv[0], opt, argv[++i], options.typesize)) return 1;
+            options.typesize = std::max<size_t>(1, options.typesize);
+        } else if (opt == "--threads" && i + 1 < argc) {
+            if (!parse_number(argv[0], opt, argv[++i], options.threads)) return 1;
+        } else if (opt == "--no-codecs") {
+            options.codecs = false;
+        } else {
+            std::cerr << "Unknown option: " << opt << std::endl;
+            return 1;
+        }
+    }
+
+    // The codecs are looked up next to this binary
+    std::error_code ec;
+    auto self = std::filesystem::canonical("/proc/self/exe", ec);
+    auto bin_dir = ec ? std::filesystem::path(argv[0]).parent_path() : self.parent_path();
+    return CodecBenchmark::run(argv[1], bin_dir, options) ? 0 : 1;
+}